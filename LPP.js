@@ -11,13 +11,35 @@
  * All devices use a custom LPP-like protocol with Type-Value pairs.
  *
  * Payload Structure:
- *   Byte 0: Reserved (0x00 for current protocol version)
+ *   Byte 0: Protocol version (0x00 or 0x01)
  *   Byte 1+: Type-Value pairs: [Type1][Value1][Type2][Value2]...
  *
+ * Protocol v1 (Byte 0 = 0x01) inserts a frame control byte before the pairs:
+ *   Byte 1: Bit7 = delta frame, Bit0-6 = baseline sequence number
+ *   Byte 2+: Type-Value pairs (all pairs for a full frame, changed pairs for a delta)
+ *
  * Each Type defines the data format and length:
  *   - Type determines value length (1-N bytes)
  *   - Parsing continues until end of payload
  *
+ * Fragmented blocks (Type 0xE0):
+ *   Blocks larger than the data rate allows (0xC6 electrical data, long 0xD9
+ *   beacon lists) may be split across uplinks. Each fragment is carried as
+ *   [0xE0][Length][Sequence][Index<<4 | Count-1][Fragment bytes...] where the
+ *   fragment bytes, concatenated in index order, form ordinary Type-Value
+ *   pairs. The decoder appends each fragment to data.fragments; the holder of
+ *   the per-device buffer (at most 16 fragments, flushed when the sequence
+ *   changes or after a timeout) calls decodeFragmentedBlock() with the
+ *   buffered fragments and the device model.
+ *
+ * Batched records (Type 0xE1):
+ *   Devices that buffer readings send them as
+ *   [0xE1][Length][Base timestamp (4 bytes)][Record count N] followed by N
+ *   records [Offset (2 bytes, seconds before base)][Record length][Type-Value pairs].
+ *   Records are reported oldest first in data.samples, each with its own
+ *   timestamp, and never overwrite the latest values in data. Type 0x01 must
+ *   precede the block so model-dependent Types decode correctly in records.
+ *
  * DEVICE SUPPORT LIST WITH PROTOCOL NOTES:
  * =========================================
  *
@@ -218,6 +240,16 @@
  *
  * 4. Device Control (Fport 2): Device-specific control commands
  *
+ * FIRMWARE UPDATE (Fport 201):
+ * ----------------------------
+ * LoRaWAN Fragmented Data Block Transport (TS004) used by FUOTA sessions.
+ *   Uplink answers (little-endian, several per frame):
+ *     0x00 PackageVersionAns: [PackageIdentifier][PackageVersion]
+ *     0x01 FragSessionStatusAns: [ReceivedAndIndex (2)][MissingFrag][Status]
+ *     0x02 FragSessionSetupAns: [StatusBitMask]
+ *     0x03 FragSessionDeleteAns: [Status]
+ *   Downlink request: {fragSessionStatusReq: {fragIndex, allParticipants}}
+ *
  * FIELD UNIFICATION:
  * ------------------
  * Common fields are reused across devices:
@@ -288,6 +320,30 @@ const MODEL_MAP = {
     0x09: "M102A"
 };
 
+/* ============================================================================
+ * PROTOCOL VERSIONS
+ * Byte 0 of every fPort 210 uplink selects the frame layout
+ * ============================================================================ */
+const PROTOCOL_V0 = 0x00; // Full Type-Value frame
+const PROTOCOL_V1 = 0x01; // Frame control byte + full or delta Type-Value frame
+
+// Protocol v1 frame control byte (byte 1)
+const V1_DELTA_FLAG = 0x80; // Bit7: frame carries only pairs changed since the baseline
+const V1_SEQ_MASK = 0x7F; // Bit0-6: baseline sequence number
+
+// Types that feed one derived field in postProcessData; a delta frame sends
+// the whole group when any member changed so the derived field is recomputed
+const V1_LINKED_TYPES = [
+    [0xB9, 0x80], // EX205: distance + liquid level -> liquidLevelPercent
+    [0xCB, 0xCD, 0xCF, 0xD1, 0xD3, 0xD5] // SC001: alarm statuses -> safetyAlarmActive
+];
+
+// Fragmented blocks (Type 0xE0): 4-bit count field bounds the per-device buffer
+const FRAGMENT_MAX_COUNT = 16;
+
+// LoRaWAN Fragmented Data Block Transport (FUOTA) port
+const FPORT_FRAGMENTATION = 201;
+
 /* ============================================================================
  * HELPER FUNCTIONS
  * ============================================================================ */
@@ -347,10 +403,11 @@ function readInt16BE(bytes, idx) {
  * @returns {number} Unsigned 32-bit integer
  */
 function readUint32BE(bytes, idx) {
-    return ((bytes[idx] & 0xFF) << 24) |
-    ((bytes[idx + 1] & 0xFF) << 16) |
-    ((bytes[idx + 2] & 0xFF) << 8) |
-    (bytes[idx + 3] & 0xFF);
+    // >>> 0 keeps values with bit 31 set unsigned
+    return (((bytes[idx] & 0xFF) << 24) |
+        ((bytes[idx + 1] & 0xFF) << 16) |
+        ((bytes[idx + 2] & 0xFF) << 8) |
+        (bytes[idx + 3] & 0xFF)) >>> 0;
 }
 
 /**
@@ -364,6 +421,12 @@ function readInt32BE(bytes, idx) {
     return val & 0x80000000 ? val - 0x100000000 : val;
 }
 
+/**
+ * Scratch DataView shared by readFloatBE, created on first use so that
+ * codec load stays cheap for devices that never report float values
+ */
+let floatScratchView = null;
+
 /**
  * Read IEEE 754 float (32-bit) from byte array (big-endian)
  * @param {number[]} bytes - Byte array
@@ -371,9 +434,11 @@ function readInt32BE(bytes, idx) {
  * @returns {number} Float value
  */
 function readFloatBE(bytes, idx) {
-    // Create a buffer and DataView to read IEEE 754 float
-    const buffer = new ArrayBuffer(4);
-    const view = new DataView(buffer);
+    // Lazily create the 4-byte buffer instead of allocating one per call
+    if (floatScratchView === null) {
+        floatScratchView = new DataView(new ArrayBuffer(4));
+    }
+    const view = floatScratchView;
 
     // Copy bytes (big-endian)
     view.setUint8(0, bytes[idx]);
@@ -404,14 +469,18 @@ function hexToBytes(hex) {
 }
 
 /**
- * Calculate Modbus CRC16 for RTU frames
- * @param {number[]} data - Byte array without CRC
- * @returns {number[]} Two CRC bytes [low, high] (little-endian)
+ * Modbus CRC16 lookup table (polynomial 0xA001), built on first use
  */
-function modbusCRC16(data) {
-    let crc = 0xFFFF;
-    for (let i = 0; i < data.length; i++) {
-        crc ^= data[i] & 0xFF;
+let modbusCRCTable = null;
+
+/**
+ * Build the 256-entry Modbus CRC16 lookup table
+ * @returns {Uint16Array} CRC of each byte value
+ */
+function buildModbusCRCTable() {
+    const table = new Uint16Array(256);
+    for (let n = 0; n < 256; n++) {
+        let crc = n;
         for (let j = 0; j < 8; j++) {
             if (crc & 0x0001) {
                 crc = (crc >> 1) ^ 0xA001;
@@ -419,6 +488,25 @@ function modbusCRC16(data) {
                 crc >>= 1;
             }
         }
+        table[n] = crc;
+    }
+    return table;
+}
+
+/**
+ * Calculate Modbus CRC16 for RTU frames
+ * @param {number[]} data - Byte array without CRC
+ * @returns {number[]} Two CRC bytes [low, high] (little-endian)
+ */
+function modbusCRC16(data) {
+    if (modbusCRCTable === null) {
+        modbusCRCTable = buildModbusCRCTable();
+    }
+
+    // One table lookup per byte instead of eight shift/xor steps
+    let crc = 0xFFFF;
+    for (let i = 0; i < data.length; i++) {
+        crc = (crc >> 8) ^ modbusCRCTable[(crc ^ data[i]) & 0xFF];
     }
     return [(crc & 0xFF), ((crc >> 8) & 0xFF)];
 }
@@ -876,51 +964,78 @@ function parseVibrationAlarm(alarmBits) {
  * ============================================================================ */
 
 /**
- * Decode uplink message from any device
- *
- * @param {object} input
- * @param {number[]} input.bytes - Byte array containing the uplink payload
- * @param {number} input.fPort - Uplink fPort (expected: 210)
- * @param {Record<string, string>} input.variables - Configured device variables
- *
- * @returns {{data: object, errors: string[], warnings: string[]}}
+ * Parse batched sample records (Type 0xE1)
+ * Batched records structure (variable length):
+ *   Bytes 0-3: Base timestamp (32-bit unsigned, big-endian, Unix time)
+ *   Byte 4: Number of records (N)
+ *   For each record:
+ *     Bytes 0-1: Time offset in seconds before base timestamp (16-bit unsigned, big-endian)
+ *     Byte 2: Record length (L)
+ *     Bytes 3..L+2: Type-Value pairs
+ * @param {number[]} batchBytes - Batched records bytes
+ * @param {string} model - Model decoded from the enclosing frame, if any
+ * @param {string[]} errors - Error list
+ * @param {string[]} warnings - Warning list
+ * @returns {object[]} Samples, each with a timestamp and the decoded fields; a
+ *          Type 0x79 value inside a record is kept as deviceTimestamp
  */
-function decodeUplink(input) {
-    const bytes = input.bytes || [];
-    const fPort = input.fPort;
-    const errors = [];
-    const warnings = [];
-    const data = {};
+function parseBatchedRecords(batchBytes, model, errors, warnings) {
+    if (!batchBytes || batchBytes.length < 5) {
+        throw new Error("Batched records data too short");
+    }
 
-    // Validate fPort
-    if (fPort !== 210) {
-        warnings.push(`Expected fPort 210, got ${fPort} - decoder may not work correctly`);
-        if (fPort !== 2 && fPort !== 220) {
-            errors.push(`Unsupported fPort: ${fPort}`);
-            return {
-                data,
-                errors,
-                warnings
-            };
+    const baseTimestamp = readUint32BE(batchBytes, 0);
+    const recordCount = batchBytes[4];
+    const samples = [];
+
+    let idx = 5;
+    for (let i = 0; i < recordCount; i++) {
+        if (idx + 3 > batchBytes.length) {
+            warnings.push(`Batched records truncated after ${i} of ${recordCount} records`);
+            break;
         }
-    }
 
-    // Validate minimum payload length
-    if (bytes.length < 2) {
-        errors.push("Payload too short (minimum 2 bytes required)");
-        return {
-            data,
-            errors,
-            warnings
-        };
+        const sample = {};
+        const recordTime = baseTimestamp - readUint16BE(batchBytes, idx);
+        const recordLen = batchBytes[idx + 2];
+        idx += 3;
+
+        // Seed the model so model-dependent Types (0x22, 0x80) and
+        // post-processing behave as in a standalone frame
+        if (model !== undefined)
+            sample.model = model;
+
+        const recordEndIdx = Math.min(idx + recordLen, batchBytes.length);
+        decodeTypeValuePairs(batchBytes.slice(idx, recordEndIdx), 0, sample, errors, warnings);
+        postProcessData(sample);
+        if (model !== undefined)
+            delete sample.model;
+
+        // Record time is set last so Type 0x79 (device clock) cannot replace it
+        if (sample.timestamp !== undefined)
+            sample.deviceTimestamp = sample.timestamp;
+        sample.timestamp = recordTime;
+        samples.push(sample);
+        idx = recordEndIdx;
     }
 
-    // First byte is reserved for protocol version (currently 0x00)
-    let idx = 1;
+    return samples;
+}
 
+/**
+ * Parse Type-Value pairs into the output object
+ * @param {number[]} bytes - Payload bytes
+ * @param {number} idx - Index of the first Type byte
+ * @param {object} data - Output object to populate
+ * @param {string[]} errors - Error list
+ * @param {string[]} warnings - Warning list
+ * @param {object[]} [pairs] - Optional list receiving {type, start, end} of each parsed pair
+ */
+function decodeTypeValuePairs(bytes, idx, data, errors, warnings, pairs) {
     // Parse all Type-Value pairs
     while (idx < bytes.length) {
         const type = bytes[idx];
+        const start = idx;
         idx++;
 
         if (type === undefined)
@@ -1354,7 +1469,20 @@ function decodeUplink(input) {
                 break;
 
                 // Type 0x80: Timer status (4 bytes bitfield, big-endian) - DS-501, DS-103
+                //           Liquid level (2 bytes unsigned, big-endian, ÷10, unit: cm) - EX205
             case 0x80:
+                // For EX205, the same Type carries the liquid level
+                if (data.model === "EX205") {
+                    if (idx + 2 > bytes.length) {
+                        warnings.push("Truncated liquid level");
+                        break;
+                    }
+                    const level = readUint16BE(bytes, idx);
+                    data.liquidLevel = Number((level / 10).toFixed(1));
+                    idx += 2;
+                    break;
+                }
+
                 if (idx + 4 > bytes.length) {
                     warnings.push("Truncated timer status");
                     break;
@@ -1405,18 +1533,6 @@ function decodeUplink(input) {
                 data.waterStatus = bytes[idx++] === 0x01 ? 1 : 0;
                 break;
 
-                // ========== RADAR LIQUID LEVEL METER (EX205) ==========
-                // Type 0x80: Liquid level (2 bytes unsigned, big-endian, ÷10, unit: cm)
-            case 0x80:
-                if (idx + 2 > bytes.length) {
-                    warnings.push("Truncated liquid level");
-                    break;
-                }
-                const level = readUint16BE(bytes, idx);
-                data.liquidLevel = Number((level / 10).toFixed(1));
-                idx += 2;
-                break;
-
                 // ========== BATTERY PERCENTAGE (SC001, AN-122, CM100) ==========
                 // Type 0x93: Battery percentage (1 byte, 0-100%)
             case 0x93:
@@ -1900,6 +2016,54 @@ function decodeUplink(input) {
                 idx = beaconEndIdx;
                 break;
 
+                // ========== BATCHED RECORDS (AN-303, EX205, EF5600-DN1) ==========
+                // Type 0xE1: Timestamped sample records (variable length)
+            case 0xE1:
+                if (idx >= bytes.length) {
+                    warnings.push("Missing batched records length");
+                    break;
+                }
+                const batchLen = bytes[idx++];
+                if (idx + batchLen > bytes.length) {
+                    warnings.push("Batched records block exceeds payload, trimming");
+                }
+                const batchEndIdx = Math.min(idx + batchLen, bytes.length);
+                const batchBytes = bytes.slice(idx, batchEndIdx);
+                data.samples = (data.samples || []).concat(parseBatchedRecords(batchBytes, data.model, errors, warnings));
+                data.samples.sort((a, b) => a.timestamp - b.timestamp);
+                idx = batchEndIdx;
+                break;
+
+                // ========== FRAGMENTED BLOCK (EF5600-DN1, CM100, SC001) ==========
+                // Type 0xE0: Fragment of an oversized block (variable length)
+            case 0xE0:
+                if (idx >= bytes.length) {
+                    warnings.push("Missing fragment length");
+                    break;
+                }
+                const fragLen = bytes[idx++];
+                if (fragLen < 2 || idx + fragLen > bytes.length) {
+                    warnings.push("Truncated fragment");
+                    idx = Math.min(idx + fragLen, bytes.length);
+                    break;
+                }
+                const fragControl = bytes[idx + 1];
+                const fragment = {
+                    seq: bytes[idx],
+                    index: fragControl >> 4,
+                    count: (fragControl & 0x0F) + 1,
+                    bytes: bytes.slice(idx + 2, idx + fragLen)
+                };
+                if (fragment.index >= fragment.count) {
+                    warnings.push(`Fragment index ${fragment.index} out of range (count ${fragment.count})`);
+                }
+                // A frame may carry several fragments, keep them all
+                if (!data.fragments)
+                    data.fragments = [];
+                data.fragments.push(fragment);
+                idx += fragLen;
+                break;
+
             default:
                 // Unknown type - skip based on common type lengths
                 warnings.push(`Unknown type 0x${type.toString(16)} at position ${idx-1}, skipping`);
@@ -1911,6 +2075,277 @@ function decodeUplink(input) {
             errors.push(`Parse error at type 0x${type.toString(16)}: ${error.message}`);
             break;
         }
+
+        if (pairs)
+            pairs.push({
+                type: type,
+                start: start,
+                end: idx
+            });
+    }
+}
+
+/**
+ * Decode protocol v1 frame
+ * Frame structure:
+ *   Byte 0: Protocol version (0x01)
+ *   Byte 1: Frame control (bit7: delta flag, bit0-6: baseline sequence)
+ *   Byte 2+: Type-Value pairs, same encoding as protocol v0
+ * A full frame (delta flag clear) establishes baseline N for the device.
+ * A delta frame carries only the pairs that changed since baseline N; the
+ * application server merges them into the state decoded from that baseline
+ * and should request a full frame when it does not hold baseline N. Encoders
+ * other than encodeDeltaUplink may split linked Types, so the server should
+ * run postProcessData again on the merged state to refresh derived fields.
+ * @param {number[]} bytes - Payload bytes
+ * @param {object} data - Output object to populate
+ * @param {string[]} errors - Error list
+ * @param {string[]} warnings - Warning list
+ */
+function decodeV1Frame(bytes, data, errors, warnings) {
+    const control = bytes[1];
+    data.protocolVersion = PROTOCOL_V1;
+    data.isDelta = (control & V1_DELTA_FLAG) ? 1 : 0;
+    data.baselineSeq = control & V1_SEQ_MASK;
+
+    decodeTypeValuePairs(bytes, 2, data, errors, warnings);
+}
+
+/**
+ * Reassemble and decode a fragmented block (Type 0xE0)
+ * Fragments are grouped by sequence number and the most recent complete group
+ * is decoded, so leftovers of an earlier block do not hide a newer one. The
+ * caller should still flush its buffer when the sequence changes or a block
+ * is decoded, to keep it bounded.
+ * @param {object[]} fragments - Fragments as reported in data.fragments, any order
+ * @param {string} [model] - Model of the sending device, for model-dependent Types
+ * @returns {{seq: number, data: object, errors: string[], warnings: string[]}|null} Decoded block, or null while fragments are missing
+ */
+function decodeFragmentedBlock(fragments, model) {
+    if (!fragments || fragments.length === 0)
+        return null;
+
+    // Order fragments of each sequence by index, ignoring duplicates
+    const groups = {};
+    const order = [];
+    for (const frag of fragments) {
+        let group = groups[frag.seq];
+        if (group === undefined) {
+            group = groups[frag.seq] = {
+                count: frag.count,
+                parts: new Array(Math.min(frag.count, FRAGMENT_MAX_COUNT)),
+                received: 0
+            };
+        }
+        // Latest appearance decides recency
+        const pos = order.indexOf(frag.seq);
+        if (pos >= 0)
+            order.splice(pos, 1);
+        order.push(frag.seq);
+
+        if (frag.count !== group.count || frag.index >= group.parts.length)
+            continue;
+        if (group.parts[frag.index] === undefined)
+            group.received++;
+        group.parts[frag.index] = frag.bytes;
+    }
+
+    for (let i = order.length - 1; i >= 0; i--) {
+        const seq = order[i];
+        const group = groups[seq];
+        if (group.count > FRAGMENT_MAX_COUNT || group.received < group.count)
+            continue;
+
+        const errors = [];
+        const warnings = [];
+        const data = {};
+
+        let blockBytes = [];
+        for (const part of group.parts) {
+            blockBytes = blockBytes.concat(part);
+        }
+
+        // Seed the model so model-dependent Types and post-processing behave
+        // as in a standalone frame
+        if (model !== undefined)
+            data.model = model;
+        decodeTypeValuePairs(blockBytes, 0, data, errors, warnings);
+        postProcessData(data);
+        if (model !== undefined)
+            delete data.model;
+
+        return {
+            seq,
+            data,
+            errors,
+            warnings
+        };
+    }
+
+    return null;
+}
+
+/**
+ * Describe the layout of an uplink for traffic profiling
+ * The fingerprint lists the Type codes in wire order (e.g. "01.10.12.11.13.77"),
+ * so frames with the same layout share a fingerprint regardless of values.
+ * @param {number[]} bytes - Uplink payload (Fport 210)
+ * @returns {{version: number, fingerprint: string, types: number[], clean: boolean}}
+ *          clean is false when the frame hit a truncated, unknown or failing Type
+ */
+function payloadLayout(bytes) {
+    const errors = [];
+    const warnings = [];
+    const pairs = [];
+    const version = bytes.length > 0 ? bytes[0] : 0;
+
+    decodeTypeValuePairs(bytes, version === PROTOCOL_V1 ? 2 : 1, {}, errors, warnings, pairs);
+
+    const types = pairs.map(pair => pair.type);
+    return {
+        version: version,
+        fingerprint: types.map(type => (type < 0x10 ? '0' : '') + type.toString(16)).join('.'),
+        types: types,
+        clean: errors.length === 0 && warnings.length === 0
+    };
+}
+
+/**
+ * Decode Fragmented Data Block Transport answers (Fport 201)
+ * @param {number[]} bytes - Payload bytes
+ * @param {object} data - Output object to populate
+ * @param {string[]} warnings - Warning list
+ */
+function decodeFragmentationAnswers(bytes, data, warnings) {
+    let idx = 0;
+    while (idx < bytes.length) {
+        const cid = bytes[idx++];
+
+        switch (cid) {
+        case 0x00: // PackageVersionAns
+            if (idx + 2 > bytes.length) {
+                warnings.push("Truncated PackageVersionAns");
+                return;
+            }
+            data.fragPackageIdentifier = bytes[idx];
+            data.fragPackageVersion = bytes[idx + 1];
+            idx += 2;
+            break;
+
+        case 0x01: // FragSessionStatusAns
+            if (idx + 4 > bytes.length) {
+                warnings.push("Truncated FragSessionStatusAns");
+                return;
+            }
+            const receivedAndIndex = (bytes[idx] & 0xFF) | ((bytes[idx + 1] & 0xFF) << 8);
+            data.fragSessionStatus = {
+                fragIndex: (receivedAndIndex >> 14) & 0x03,
+                receivedCount: receivedAndIndex & 0x3FFF,
+                missingCount: bytes[idx + 2],
+                notEnoughMatrixMemory: (bytes[idx + 3] & 0x01) !== 0
+            };
+            idx += 4;
+            break;
+
+        case 0x02: // FragSessionSetupAns
+            if (idx >= bytes.length) {
+                warnings.push("Truncated FragSessionSetupAns");
+                return;
+            }
+            const setupStatus = bytes[idx++];
+            data.fragSessionSetup = {
+                fragIndex: (setupStatus >> 6) & 0x03,
+                encodingUnsupported: (setupStatus & 0x01) !== 0,
+                notEnoughMemory: (setupStatus & 0x02) !== 0,
+                fragIndexNotSupported: (setupStatus & 0x04) !== 0,
+                wrongDescriptor: (setupStatus & 0x08) !== 0,
+                accepted: (setupStatus & 0x0F) === 0
+            };
+            break;
+
+        case 0x03: // FragSessionDeleteAns
+            if (idx >= bytes.length) {
+                warnings.push("Truncated FragSessionDeleteAns");
+                return;
+            }
+            const deleteStatus = bytes[idx++];
+            data.fragSessionDelete = {
+                fragIndex: deleteStatus & 0x03,
+                sessionNotExist: (deleteStatus & 0x04) !== 0
+            };
+            break;
+
+        default:
+            // Answer lengths are defined per command, so parsing cannot continue
+            warnings.push(`Unknown fragmentation command 0x${cid.toString(16)} at position ${idx-1}, ignoring rest of payload`);
+            return;
+        }
+    }
+}
+
+/**
+ * Decode uplink message from any device
+ *
+ * @param {object} input
+ * @param {number[]} input.bytes - Byte array containing the uplink payload
+ * @param {number} input.fPort - Uplink fPort (expected: 210)
+ * @param {Record<string, string>} input.variables - Configured device variables
+ *
+ * @returns {{data: object, errors: string[], warnings: string[]}}
+ */
+function decodeUplink(input) {
+    const bytes = input.bytes || [];
+    const fPort = input.fPort;
+    const errors = [];
+    const warnings = [];
+    const data = {};
+
+    // FUOTA answers use the LoRaWAN fragmentation package layout
+    if (fPort === FPORT_FRAGMENTATION) {
+        decodeFragmentationAnswers(bytes, data, warnings);
+        return {
+            data,
+            errors,
+            warnings
+        };
+    }
+
+    // Validate fPort
+    if (fPort !== 210) {
+        warnings.push(`Expected fPort 210, got ${fPort} - decoder may not work correctly`);
+        if (fPort !== 2 && fPort !== 220) {
+            errors.push(`Unsupported fPort: ${fPort}`);
+            return {
+                data,
+                errors,
+                warnings
+            };
+        }
+    }
+
+    // Validate minimum payload length
+    if (bytes.length < 2) {
+        errors.push("Payload too short (minimum 2 bytes required)");
+        return {
+            data,
+            errors,
+            warnings
+        };
+    }
+
+    // First byte carries the protocol version
+    const version = bytes[0];
+    switch (version) {
+    case PROTOCOL_V0:
+        decodeTypeValuePairs(bytes, 1, data, errors, warnings);
+        break;
+    case PROTOCOL_V1:
+        decodeV1Frame(bytes, data, errors, warnings);
+        break;
+    default:
+        warnings.push(`Unknown protocol version 0x${version.toString(16)}, decoding as version 0x00`);
+        decodeTypeValuePairs(bytes, 1, data, errors, warnings);
+        break;
     }
 
     postProcessData(data);
@@ -1953,10 +2388,85 @@ function postProcessData(data) {
             data.silenceAlarmStatus,
             data.heightAccessAlarmStatus
         ];
-        data.safetyAlarmActive = safetyAlarms.some(alarm => alarm === 1) ? 1 : 0;
+        // Delta frames omit unchanged alarms, so only derive when any is active
+        // or all are present
+        const anyActive = safetyAlarms.some(alarm => alarm === 1);
+        if (data.isDelta !== 1 || anyActive || safetyAlarms.every(alarm => alarm !== undefined)) {
+            data.safetyAlarmActive = anyActive ? 1 : 0;
+        }
     }
 }
 
+/* ============================================================================
+ * UPLINK ENCODER - DEVICE FIRMWARE REFERENCE
+ * ============================================================================ */
+
+/**
+ * Build protocol v1 uplink from protocol v0 payloads
+ * Reference implementation of the device side of the delta format:
+ *   - Without a baseline, emits a full v1 frame that becomes baseline N
+ *   - With a baseline, emits only the Types whose values changed
+ * Type 0x01 (model) is always kept because decoding of repeated Types such as
+ * 0x22 depends on it, and a repeated Type is sent with all its occurrences
+ * whenever any of them changed, so positional decoding stays intact. Types in
+ * V1_LINKED_TYPES are sent as a group so derived fields are never left stale.
+ * @param {number[]} current - Current protocol v0 payload
+ * @param {number[]|null} baseline - Baseline protocol v0 payload, or null for a full frame
+ * @param {number} baselineSeq - Baseline sequence number (0-127)
+ * @returns {number[]} Protocol v1 payload
+ */
+function encodeDeltaUplink(current, baseline, baselineSeq) {
+    const seq = baselineSeq & V1_SEQ_MASK;
+
+    if (!baseline) {
+        return [PROTOCOL_V1, seq].concat(current.slice(1));
+    }
+
+    // Collect the value bytes of every occurrence of each Type
+    const collect = (bytes) => {
+        const pairs = [];
+        decodeTypeValuePairs(bytes, 1, {}, [], [], pairs);
+        const values = {};
+        for (const pair of pairs) {
+            const key = bytes.slice(pair.start, pair.end).join(',');
+            values[pair.type] = values[pair.type] === undefined ? key : values[pair.type] + ';' + key;
+        }
+        return {
+            pairs,
+            values
+        };
+    };
+
+    const cur = collect(current);
+    const base = collect(baseline);
+
+    // Types to send: model, changed Types, and the groups of linked changed Types
+    const send = {
+        0x01: true
+    };
+    for (const pair of cur.pairs) {
+        if (cur.values[pair.type] !== base.values[pair.type])
+            send[pair.type] = true;
+    }
+    for (const group of V1_LINKED_TYPES) {
+        if (group.some(type => send[type])) {
+            group.forEach(type => {
+                send[type] = true;
+            });
+        }
+    }
+
+    const out = [PROTOCOL_V1, V1_DELTA_FLAG | seq];
+    for (const pair of cur.pairs) {
+        if (send[pair.type]) {
+            for (let i = pair.start; i < pair.end; i++) {
+                out.push(current[i] & 0xFF);
+            }
+        }
+    }
+    return out;
+}
+
 /* ============================================================================
  * DOWNLINK ENCODER - DEVICE-SPECIFIC FUNCTIONS
  * ============================================================================ */
@@ -2154,16 +2664,23 @@ function encodeAN307(data) {
 
 /**
  * W8004 Thermostat downlink encoder
+ * Attributes written together are coalesced into one Modbus write. Registers
+ * that are not consecutive with the largest group cannot share the frame;
+ * their names are appended to deferred (and reported in warnings) so the
+ * caller can send them in a later downlink.
  * @param {object} data - Control data
+ * @param {string[]} [warnings] - Warning list
+ * @param {string[]} [deferred] - Receives names of attributes not sent
  * @returns {number[]} Encoded bytes or empty array if no command
  */
-function encodeW8004(data) {
+function encodeW8004(data, warnings, deferred) {
     const attributes = [];
 
     // Collect attributes to set
     if (data.setTemperature !== undefined) {
         const tempValue = Math.round(Number(data.setTemperature) * 100);
         attributes.push({
+            name: 'setTemperature',
             register: 0x0004,
             value: tempValue
         });
@@ -2172,6 +2689,7 @@ function encodeW8004(data) {
     if (data.workMode !== undefined) {
         const mode = Math.max(0, Math.min(3, Math.round(Number(data.workMode))));
         attributes.push({
+            name: 'workMode',
             register: 0x0005,
             value: mode
         });
@@ -2180,6 +2698,7 @@ function encodeW8004(data) {
     if (data.fanSpeed !== undefined) {
         const speed = Math.max(0, Math.min(4, Math.round(Number(data.fanSpeed))));
         attributes.push({
+            name: 'fanSpeed',
             register: 0x0006,
             value: speed
         });
@@ -2188,6 +2707,7 @@ function encodeW8004(data) {
     if (data.powerState !== undefined) {
         const state = Number(data.powerState) ? 1 : 0;
         attributes.push({
+            name: 'powerState',
             register: 0xF000,
             value: state
         });
@@ -2196,6 +2716,7 @@ function encodeW8004(data) {
     if (data.keyLockState !== undefined) {
         const state = Number(data.keyLockState) ? 1 : 0;
         attributes.push({
+            name: 'keyLockState',
             register: 0xF001,
             value: state
         });
@@ -2205,58 +2726,66 @@ function encodeW8004(data) {
         return [];
     }
 
-    if (attributes.length === 1) {
-        // Single register write - use 06 instruction
-        const attr = attributes[0];
-        return [0x06, 0x06,
-            (attr.register >> 8) & 0xFF, attr.register & 0xFF,
-            (attr.value >> 8) & 0xFF, attr.value & 0xFF];
-    }
-
-    // Multiple registers - check if consecutive
+    // Group attributes into runs of consecutive registers
     attributes.sort((a, b) => a.register - b.register);
-    let isConsecutive = true;
-    for (let i = 1; i < attributes.length; i++) {
-        if (attributes[i].register !== attributes[i - 1].register + 1) {
-            isConsecutive = false;
-            break;
+    const runs = [];
+    for (const attr of attributes) {
+        const run = runs[runs.length - 1];
+        if (run && attr.register === run[run.length - 1].register + 1) {
+            run.push(attr);
+        } else {
+            runs.push([attr]);
         }
     }
 
-    if (isConsecutive) {
-        // Use Modbus function code 0x10 (write multiple registers)
-        const slaveAddr = data.rs485Addr || 0x01;
-        const startReg = attributes[0].register;
-        const regCount = attributes.length;
-        const byteCount = regCount * 2;
-
-        // Build Modbus frame
-        const frame = [
-            slaveAddr,
-            0x10, // Function code
-            (startReg >> 8) & 0xFF, startReg & 0xFF,
-            (regCount >> 8) & 0xFF, regCount & 0xFF,
-            byteCount
-        ];
-
-        // Add register values
-        for (const attr of attributes) {
-            frame.push((attr.value >> 8) & 0xFF, attr.value & 0xFF);
-        }
-
-        // Calculate CRC
-        const crc = modbusCRC16(frame);
-        frame.push(crc[0], crc[1]);
+    // Send the largest run (lowest registers on a tie), report the rest
+    let selected = runs[0];
+    for (const run of runs) {
+        if (run.length > selected.length)
+            selected = run;
+    }
+    if (runs.length > 1) {
+        const notSent = attributes.filter(attr => selected.indexOf(attr) < 0).map(attr => attr.name);
+        if (deferred)
+            deferred.push(...notSent);
+        if (warnings)
+            warnings.push(`W8004 registers not consecutive, not sent: ${notSent.join(', ')}`);
+    }
 
-        // Add 07 instruction header
-        return [0x07].concat(frame);
-    } else {
-        // Non-consecutive - use first attribute
-        const attr = attributes[0];
+    if (selected.length === 1) {
+        // Single register write - use 06 instruction
+        const attr = selected[0];
         return [0x06, 0x06,
             (attr.register >> 8) & 0xFF, attr.register & 0xFF,
             (attr.value >> 8) & 0xFF, attr.value & 0xFF];
     }
+
+    // Use Modbus function code 0x10 (write multiple registers)
+    const slaveAddr = data.rs485Addr || 0x01;
+    const startReg = selected[0].register;
+    const regCount = selected.length;
+    const byteCount = regCount * 2;
+
+    // Build Modbus frame
+    const frame = [
+        slaveAddr,
+        0x10, // Function code
+        (startReg >> 8) & 0xFF, startReg & 0xFF,
+        (regCount >> 8) & 0xFF, regCount & 0xFF,
+        byteCount
+    ];
+
+    // Add register values
+    for (const attr of selected) {
+        frame.push((attr.value >> 8) & 0xFF, attr.value & 0xFF);
+    }
+
+    // Calculate CRC
+    const crc = modbusCRC16(frame);
+    frame.push(crc[0], crc[1]);
+
+    // Add 07 instruction header
+    return [0x07].concat(frame);
 }
 
 /**
@@ -2474,6 +3003,34 @@ function encodeDownlink(input) {
         };
     }
 
+    // ========== FIRMWARE UPDATE: FRAG SESSION STATUS (Fport 201) ==========
+    // Asks one device (or all multicast participants) which fragments are missing
+    // Format: 0x01 + FragStatusReqParam (bit1-2: fragIndex, bit0: all participants)
+    if (data.fragSessionStatusReq !== undefined) {
+        const req = data.fragSessionStatusReq || {};
+        // Only an omitted fragIndex defaults to session 0; null or '' are rejected
+        const rawIndex = req.fragIndex === undefined ? 0 : req.fragIndex;
+        const fragIndex = typeof rawIndex === 'number' || (typeof rawIndex === 'string' && rawIndex.trim() !== '') ?
+            Number(rawIndex) : NaN;
+        if (!Number.isInteger(fragIndex) || fragIndex < 0 || fragIndex > 3) {
+            errors.push(`Invalid fragIndex: ${req.fragIndex} (expected 0-3)`);
+            return {
+                bytes: [],
+                fPort: FPORT_FRAGMENTATION,
+                errors,
+                warnings
+            };
+        }
+
+        bytes = [0x01, (fragIndex << 1) | (req.allParticipants ? 0x01 : 0x00)];
+        return {
+            bytes,
+            fPort: FPORT_FRAGMENTATION,
+            errors,
+            warnings
+        };
+    }
+
     // ========== MODE 4: RAW BYTES (Fport 2) ==========
     if (Array.isArray(data.rawBytes) && data.rawBytes.length > 0) {
         bytes = data.rawBytes.map(b => b & 0xFF);
@@ -2488,6 +3045,7 @@ function encodeDownlink(input) {
     // ========== MODE 5: DEVICE-SPECIFIC CONTROL ==========
     // Call appropriate device encoder based on model
     const model = data.model || "";
+    const deferred = [];
 
     switch (model) {
     case "DS-501":
@@ -2500,7 +3058,7 @@ function encodeDownlink(input) {
         bytes = encodeAN307(data);
         break;
     case "W8004":
-        bytes = encodeW8004(data);
+        bytes = encodeW8004(data, warnings, deferred);
         break;
     case "AN-301":
         bytes = encodeAN301(data);
@@ -2563,12 +3121,16 @@ function encodeDownlink(input) {
     }
 
     if (bytes.length > 0) {
-        return {
+        const result = {
             bytes,
             fPort: 2,
             errors,
             warnings
         };
+        // Attributes left for a later downlink (W8004 non-consecutive registers)
+        if (deferred.length > 0)
+            result.deferred = deferred;
+        return result;
     }
 
     // No valid command found